@@ -52,6 +52,8 @@
  *       set the fast cadence period (how fast the data has to be published with respect to publish period).
  *       set the unit in which if the values change the data should be published and trigger type (Native or percentage).
  *           example : publish data if the data changes by 2 units/10%
+ *    d> optionally write the publication retransmit policy setting (see MESH_TEMPERATURE_SENSOR_PUB_POLICY_PROPERTY_ID)
+ *       to change how many times each publication is retransmitted depending on the reason and size of the change.
  * 4. To change the temperature on the thermistor, you can keep your finger on the sensor and see the changes.
  */
 #include "wiced_bt_uuid.h"
@@ -65,7 +67,11 @@
 #include "wiced_hal_nvram.h"
 #include "wiced_sleep.h"
 #include "wiced_hal_adc.h"
+#include "wiced_hal_gpio.h"
 #include "wiced_platform.h"
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+#include "clock_timer.h"
+#endif
 
 #include "wiced_bt_cfg.h"
 extern wiced_bt_cfg_settings_t wiced_bt_cfg_settings;
@@ -88,6 +94,39 @@ extern wiced_bt_cfg_settings_t wiced_bt_cfg_settings;
 #define MESH_TEMPERATURE_SENSOR_UPDATE_INTERVAL         WICED_BT_MESH_SENSOR_VAL_UNKNOWN
 
 #define MESH_TEMPERATURE_SENSOR_CADENCE_NVRAM_ID        WICED_NVRAM_VSID_START
+#define MESH_TEMPERATURE_SENSOR_PUB_POLICY_NVRAM_ID     (WICED_NVRAM_VSID_START + 1)
+
+// Vendor specific setting property which selects publication retransmissions depending on whether the publication
+// is periodic and on the change of the value since the last publication.  The setting value is
+//   byte 0 : number of retransmissions of periodic publications when value has not changed
+//   byte 1 : interval between these retransmissions in 50ms units (1-32)
+//   byte 2 : number of retransmissions when value changed by large delta or entered fast cadence range
+//   byte 3 : interval between these retransmissions in 50ms units (1-32)
+//   byte 4 : large delta in Temperature 8 units (0.5 degree Celsius), 0 disables the policy
+//   byte 5 : small delta in Temperature 8 units, change up to this value is treated as no change
+// Other publications use the model publication retransmit configured by the provisioner.
+#define MESH_TEMPERATURE_SENSOR_PUB_POLICY_PROPERTY_ID  0xFF01
+#define MESH_TEMPERATURE_SENSOR_PUB_POLICY_LEN          6
+
+#define MESH_SENSOR_PUB_POLICY_BASE_RETRANS_CNT         0
+#define MESH_SENSOR_PUB_POLICY_BASE_RETRANS_TIME        1
+#define MESH_SENSOR_PUB_POLICY_BOOST_RETRANS_CNT        2
+#define MESH_SENSOR_PUB_POLICY_BOOST_RETRANS_TIME       3
+#define MESH_SENSOR_PUB_POLICY_LARGE_DELTA              4
+#define MESH_SENSOR_PUB_POLICY_SMALL_DELTA              5
+
+#define MESH_SENSOR_MAX_RETRANS_CNT                     7   // publish retransmit count is 3 bits
+#define MESH_SENSOR_MAX_RETRANS_TIME                    32  // 1.6s in 50ms units, the longest publish retransmit interval
+
+// Time for the thermistor voltage divider to settle after it has been powered up.  The divider RC on the
+// boards has not been characterized, the value is a conservative guess which can be tuned by the build.
+#ifndef MESH_SENSOR_ADC_SETTLE_TIME_MS
+#define MESH_SENSOR_ADC_SETTLE_TIME_MS                  5
+#endif
+// Delay before conversion on boards without divider power control, just to return from the caller context
+#define MESH_SENSOR_ADC_CONVERT_DELAY_MS                1
+// Max number of Sensor Get requests waiting for the measurement in progress
+#define MESH_SENSOR_MAX_PENDING_GET                     4
 
 /******************************************************************************
  *                                Constants
@@ -119,9 +158,49 @@ extern wiced_bt_cfg_settings_t wiced_bt_cfg_settings;
 #define THERMISTOR_PIN THERMISTOR_aux_0_TRIGGER_OUT
 
 #endif
+
+#if defined (CYBLE_343072_MESH) // this BSP uses thermistor_ncp15xv103_lib
+#define THERMISTOR_HIGH_PIN         ADC_INPUT_P14
+#define THERMISTOR_LOW_PIN          ADC_INPUT_P8
+#define THERMISTOR_ADC_POWER_PIN    WICED_P07
+#elif defined (CYBT_213043_MESH) // this BSP uses thermistor_ncp15xv103_lib
+#define THERMISTOR_HIGH_PIN         ADC_INPUT_P14
+#define THERMISTOR_LOW_PIN          ADC_INPUT_P11
+#define THERMISTOR_ADC_POWER_PIN    WICED_P09
+#endif
+
 /******************************************************
  *          Structures
  ******************************************************/
+// State of the temperature measurement, i.e. what the measurement timer is waiting for.  The measurement
+// runs power-on, settle, convert and power-off stages.  The divider settling time is spent on the timer,
+// so that the core can sleep or process mesh traffic meanwhile.  Power-off runs right after convert,
+// waiting on the timer there would only keep the divider powered longer.
+typedef enum
+{
+    MESH_SENSOR_MEASURE_STATE_IDLE,             // no measurement in progress
+    MESH_SENSOR_MEASURE_STATE_SETTLE,           // divider is powered, convert and power-off run when the voltage settles
+    MESH_SENSOR_MEASURE_STATE_CONVERT_PENDING,  // no divider power control, convert is deferred out of the caller context
+} mesh_sensor_measure_state_t;
+
+// Sensor Get request to be answered when the measurement completes
+typedef struct
+{
+    uint8_t     element_idx;
+    uint16_t    property_id;
+    void        *p_ref_data;
+} mesh_sensor_pending_get_t;
+
+typedef struct
+{
+    mesh_sensor_measure_state_t         state;
+    wiced_bt_mesh_core_config_sensor_t  *p_publish_sensor;  // not NULL if publication check waits for the measurement
+    uint8_t                             num_pending_get;
+    mesh_sensor_pending_get_t           pending_get[MESH_SENSOR_MAX_PENDING_GET];
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    uint32_t                            active_us;          // CPU time spent in the stages of the measurement
+#endif
+} mesh_sensor_measure_t;
 
 /******************************************************
  *          Function Prototypes
@@ -136,7 +215,22 @@ static void         mesh_sensor_server_config_change_handler(uint8_t element_idx
 static void         mesh_sensor_server_process_cadence_changed(uint8_t element_idx, wiced_bt_mesh_sensor_cadence_status_data_t* p_data);
 static void         mesh_sensor_server_process_setting_changed(uint8_t element_idx, wiced_bt_mesh_sensor_setting_status_data_t* p_data);
 static int8_t       mesh_sensor_get_temperature_8(void);
+static void         mesh_sensor_thermistor_cfg_init(thermistor_cfg_t *p_thermistor_cfg);
+static int8_t       mesh_sensor_convert_temperature_8(int16_t temp_celsius_100);
+static void         mesh_sensor_measure_start(void);
+static void         mesh_sensor_measure_power_on(void);
+static int8_t       mesh_sensor_measure_convert(void);
+static void         mesh_sensor_measure_power_off(void);
+static void         mesh_sensor_measure_finish(void);
+static void         mesh_sensor_measure_timer_callback(TIMER_PARAM_TYPE arg);
+static void         mesh_sensor_measure_complete(int8_t value);
+#if defined(LOW_POWER_NODE) && (LOW_POWER_NODE == 1)
+static void         mesh_sensor_measure_abort(void);
+#endif
 static void         mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg);
+static void         mesh_sensor_publish_check(wiced_bt_mesh_core_config_sensor_t *p_sensor);
+static wiced_bool_t mesh_sensor_in_fast_cadence_range(wiced_bt_mesh_core_config_sensor_t *p_sensor, int8_t value);
+static void         mesh_sensor_pub_policy_apply(wiced_bt_mesh_event_t *p_event, wiced_bool_t periodic, uint8_t delta, wiced_bool_t fast_cadence_entered);
 static void         mesh_sensor_server_enter_hid_off(uint32_t timeout_ms);
 
 
@@ -157,10 +251,17 @@ uint32_t      mesh_sensor_publish_period = 0;           // publish period in mse
 uint32_t      mesh_sensor_fast_publish_period = 0;      // publish period in msec when values are outside of limit
 uint32_t      mesh_sensor_measure_min_interval = 3000;  // Measure temperature at least every 3 seconds
 wiced_timer_t mesh_sensor_cadence_timer;
+wiced_timer_t mesh_sensor_measure_timer;                // timer to run stages of the temperature measurement
+mesh_sensor_measure_t mesh_sensor_measure;              // state of the temperature measurement in progress
 
 // Optional setting for the temperature sensor, the Total Device Runtime, in Time Hour 24 format
 uint8_t mesh_temperature_sensor_setting0_val[] = { 0x01, 0x00, 0x00 };
 
+// Publication retransmit policy.  Unchanged periodic report is repeated on the next period, so it is sent once.  Large
+// change is sent 4 times 200ms apart: 99.85% delivery with interference bursts, see tools/pub_retransmit_sim.py.
+// Change of 1 unit (0.5 degree) is thermistor jitter and is treated as no change.
+uint8_t mesh_temperature_sensor_setting1_val[MESH_TEMPERATURE_SENSOR_PUB_POLICY_LEN] = { 0, 1, 3, 4, 10, 1 };
+
 wiced_bt_mesh_core_config_model_t mesh_element1_models[] =
 {
     WICED_BT_MESH_DEVICE,
@@ -176,7 +277,14 @@ wiced_bt_mesh_sensor_config_setting_t sensor_settings[] =
         .value_len           = WICED_BT_MESH_PROPERTY_LEN_TOTAL_DEVICE_RUNTIME,
         .val                 = mesh_temperature_sensor_setting0_val
     },
+    {
+        .setting_property_id = MESH_TEMPERATURE_SENSOR_PUB_POLICY_PROPERTY_ID,
+        .access              = WICED_BT_MESH_SENSOR_SETTING_READABLE_AND_WRITABLE,
+        .value_len           = MESH_TEMPERATURE_SENSOR_PUB_POLICY_LEN,
+        .val                 = mesh_temperature_sensor_setting1_val
+    },
 };
+#define MESH_TEMPERATURE_SENSOR_NUM_SETTINGS (sizeof(sensor_settings) / sizeof(wiced_bt_mesh_sensor_config_setting_t))
 
 wiced_bt_mesh_core_config_sensor_t mesh_element1_sensors[] =
 {
@@ -205,7 +313,7 @@ wiced_bt_mesh_core_config_sensor_t mesh_element1_sensors[] =
         },
         .num_series     = 0,
         .series_columns = NULL,
-        .num_settings   = 1,
+        .num_settings   = MESH_TEMPERATURE_SENSOR_NUM_SETTINGS,
         .settings       = sensor_settings,
     },
 };
@@ -359,6 +467,9 @@ void mesh_app_init(wiced_bool_t is_provisioned)
     // read the initial temperature
     mesh_sensor_current_value = mesh_sensor_get_temperature_8();
 
+    // initialize the timer used to run stages of the temperature measurement
+    wiced_init_timer(&mesh_sensor_measure_timer, &mesh_sensor_measure_timer_callback, 0, WICED_MILLI_SECONDS_TIMER);
+
     // initialize the cadence timer.  Need a timer for each element because each sensor model can be
     // configured for different publication period.  This app has only one sensor.
     wiced_init_timer(&mesh_sensor_cadence_timer, &mesh_sensor_publish_timer_callback, (TIMER_PARAM_TYPE)&mesh_config.elements[MESH_SENSOR_SERVER_ELEMENT_INDEX].sensors[MESH_TEMPERATURE_SENSOR_INDEX], WICED_MILLI_SECONDS_TIMER);
@@ -366,6 +477,9 @@ void mesh_app_init(wiced_bool_t is_provisioned)
     //restore the cadence from NVRAM
     wiced_hal_read_nvram(MESH_TEMPERATURE_SENSOR_CADENCE_NVRAM_ID, sizeof(wiced_bt_mesh_sensor_config_cadence_t), (uint8_t*)(&p_sensor->cadence), &result);
 
+    //restore the publication retransmit policy from NVRAM
+    wiced_hal_read_nvram(MESH_TEMPERATURE_SENSOR_PUB_POLICY_NVRAM_ID, MESH_TEMPERATURE_SENSOR_PUB_POLICY_LEN, mesh_temperature_sensor_setting1_val, &result);
+
     wiced_bt_mesh_model_sensor_server_init(MESH_SENSOR_SERVER_ELEMENT_INDEX, mesh_sensor_server_report_handler, mesh_sensor_server_config_change_handler, is_provisioned);
 
     mesh_sensor_pub_value = mesh_sensor_current_value;
@@ -397,6 +511,9 @@ wiced_bool_t mesh_app_notify_period_set(uint8_t element_idx, uint16_t company_id
 void mesh_app_lpn_sleep(uint32_t timeout_ms)
 {
 #if defined(LOW_POWER_NODE) && (LOW_POWER_NODE == 1)
+    // Do not leave the divider powered in HID-Off
+    mesh_sensor_measure_abort();
+
     if (wiced_sleep_enter_hid_off(timeout_ms, WICED_HAL_GPIO_PIN_UNUSED, WICED_GPIO_ACTIVE_LOW) != WICED_SUCCESS)
     {
         WICED_BT_TRACE("Entering HID-Off failed\n\r");
@@ -410,6 +527,7 @@ void mesh_app_lpn_sleep(uint32_t timeout_ms)
 void mesh_app_factory_reset(void)
 {
     wiced_hal_delete_nvram(MESH_TEMPERATURE_SENSOR_CADENCE_NVRAM_ID, NULL);
+    wiced_hal_delete_nvram(MESH_TEMPERATURE_SENSOR_PUB_POLICY_NVRAM_ID, NULL);
 }
 
 /*
@@ -454,27 +572,26 @@ void mesh_sensor_server_restart_timer(wiced_bt_mesh_core_config_sensor_t *p_sens
 }
 
 /*
- * Helper function to read temperature from the thermistor and convert temperature in celsius
- * to Temperature 8 format.  Unit is degree Celsius with a resolution of 0.5. Minimum: -64.0 Maximum: 63.5.
+ * Helper function to fill thermistor configuration for the board
  */
-int8_t mesh_sensor_get_temperature_8(void)
+void mesh_sensor_thermistor_cfg_init(thermistor_cfg_t *p_thermistor_cfg)
 {
-    thermistor_cfg_t thermistor_cfg;
-    memset(&thermistor_cfg, 0, sizeof(thermistor_cfg_t));
-#if defined (CYBLE_343072_MESH) // this BSP uses thermistor_ncp15xv103_lib
-    thermistor_cfg.high_pin       = ADC_INPUT_P14;
-    thermistor_cfg.low_pin        = ADC_INPUT_P8;
-    thermistor_cfg.adc_power_pin  = WICED_P07;
-#elif defined (CYBT_213043_MESH) // this BSP uses thermistor_ncp15xv103_lib
-    thermistor_cfg.high_pin       = ADC_INPUT_P14;
-    thermistor_cfg.low_pin        = ADC_INPUT_P11;
-    thermistor_cfg.adc_power_pin  = WICED_P09;
+    memset(p_thermistor_cfg, 0, sizeof(thermistor_cfg_t));
+#ifdef THERMISTOR_ADC_POWER_PIN
+    p_thermistor_cfg->high_pin       = THERMISTOR_HIGH_PIN;
+    p_thermistor_cfg->low_pin        = THERMISTOR_LOW_PIN;
+    p_thermistor_cfg->adc_power_pin  = THERMISTOR_ADC_POWER_PIN;
 #else
-    thermistor_cfg.high_pin = THERMISTOR_PIN; /* Input channel to measure DC voltage(temperature)-> GPIO 10 -> J12.1, J14.1 */
+    p_thermistor_cfg->high_pin = THERMISTOR_PIN; /* Input channel to measure DC voltage(temperature)-> GPIO 10 -> J12.1, J14.1 */
 #endif
+}
 
-    int16_t temp_celsius_100 = thermistor_read(&thermistor_cfg);
-
+/*
+ * Helper function to convert temperature in 0.01 degree Celsius to Temperature 8 format.
+ * Unit is degree Celsius with a resolution of 0.5. Minimum: -64.0 Maximum: 63.5.
+ */
+int8_t mesh_sensor_convert_temperature_8(int16_t temp_celsius_100)
+{
     if (temp_celsius_100 < -6400)
     {
         return 0x80;
@@ -489,6 +606,195 @@ int8_t mesh_sensor_get_temperature_8(void)
     }
 }
 
+/*
+ * Helper function to read temperature from the thermistor and convert temperature in celsius
+ * to Temperature 8 format.  The read is synchronous, the thermistor library powers the divider.
+ * It is used during initialization and for Sensor Get on LPN, all other measurements go through
+ * mesh_sensor_measure_start.
+ */
+int8_t mesh_sensor_get_temperature_8(void)
+{
+    thermistor_cfg_t thermistor_cfg;
+    int8_t value;
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    uint64_t start_us = clock_SystemTimeMicroseconds64();
+#endif
+
+    mesh_sensor_thermistor_cfg_init(&thermistor_cfg);
+    value = mesh_sensor_convert_temperature_8(thermistor_read(&thermistor_cfg));
+
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    WICED_BT_TRACE("Sync sample active time:%d us\n", (uint32_t)(clock_SystemTimeMicroseconds64() - start_us));
+#endif
+    return value;
+}
+
+/*
+ * Start temperature measurement.  Run the power-on stage and let the divider settle on the timer,
+ * on boards without divider power control just defer the conversion to the timer.
+ * If measurement is already in progress, the new request will be served when it completes.
+ * If the timer cannot be started, the measurement is completed synchronously.
+ */
+void mesh_sensor_measure_start(void)
+{
+    wiced_result_t result;
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    uint64_t start_us = clock_SystemTimeMicroseconds64();
+#endif
+
+    if (mesh_sensor_measure.state != MESH_SENSOR_MEASURE_STATE_IDLE)
+    {
+        return;
+    }
+
+#ifdef THERMISTOR_ADC_POWER_PIN
+    mesh_sensor_measure_power_on();
+    mesh_sensor_measure.state = MESH_SENSOR_MEASURE_STATE_SETTLE;
+    result = wiced_start_timer(&mesh_sensor_measure_timer, MESH_SENSOR_ADC_SETTLE_TIME_MS);
+#else
+    mesh_sensor_measure.state = MESH_SENSOR_MEASURE_STATE_CONVERT_PENDING;
+    result = wiced_start_timer(&mesh_sensor_measure_timer, MESH_SENSOR_ADC_CONVERT_DELAY_MS);
+#endif
+
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    mesh_sensor_measure.active_us = (uint32_t)(clock_SystemTimeMicroseconds64() - start_us);
+#endif
+
+    if (result != WICED_SUCCESS)
+    {
+        WICED_BT_TRACE("measure timer start failed:%d\n", result);
+        mesh_sensor_measure_finish();
+    }
+}
+
+/*
+ * Power-on stage.  Power up the thermistor divider if the board controls it.
+ */
+void mesh_sensor_measure_power_on(void)
+{
+#ifdef THERMISTOR_ADC_POWER_PIN
+    wiced_hal_gpio_configure_pin(THERMISTOR_ADC_POWER_PIN, GPIO_OUTPUT_ENABLE, GPIO_PIN_OUTPUT_HIGH);
+#endif
+}
+
+/*
+ * Convert stage.  The thermistor library is given the real power pin, because it is not known whether it
+ * skips an unused pin.  The divider is already powered and settled, so the library driving the pin high is
+ * harmless.  Whether the library also waits after that is not known, the settle stage does not remove it.
+ */
+int8_t mesh_sensor_measure_convert(void)
+{
+    thermistor_cfg_t thermistor_cfg;
+
+    mesh_sensor_thermistor_cfg_init(&thermistor_cfg);
+    return mesh_sensor_convert_temperature_8(thermistor_read(&thermistor_cfg));
+}
+
+/*
+ * Power-off stage.  Power down the thermistor divider if the board controls it.
+ */
+void mesh_sensor_measure_power_off(void)
+{
+#ifdef THERMISTOR_ADC_POWER_PIN
+    wiced_hal_gpio_configure_pin(THERMISTOR_ADC_POWER_PIN, GPIO_OUTPUT_ENABLE, GPIO_PIN_OUTPUT_LOW);
+#endif
+}
+
+/*
+ * Run convert and power-off stages and deliver the value to everybody waiting for it.
+ */
+void mesh_sensor_measure_finish(void)
+{
+    int8_t value;
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    uint64_t start_us = clock_SystemTimeMicroseconds64();
+#endif
+
+    value = mesh_sensor_measure_convert();
+    mesh_sensor_measure_power_off();
+    mesh_sensor_measure.state = MESH_SENSOR_MEASURE_STATE_IDLE;
+
+#if defined(MESH_SENSOR_MEASURE_PROFILE) && (MESH_SENSOR_MEASURE_PROFILE == 1)
+    mesh_sensor_measure.active_us += (uint32_t)(clock_SystemTimeMicroseconds64() - start_us);
+    WICED_BT_TRACE("Staged sample active time:%d us\n", mesh_sensor_measure.active_us);
+#endif
+
+    mesh_sensor_measure_complete(value);
+}
+
+/*
+ * Measurement timer callback.  The divider has settled, or conversion has been deferred, finish the measurement.
+ */
+void mesh_sensor_measure_timer_callback(TIMER_PARAM_TYPE arg)
+{
+    if (mesh_sensor_measure.state == MESH_SENSOR_MEASURE_STATE_IDLE)
+    {
+        return;
+    }
+    mesh_sensor_measure_finish();
+}
+
+/*
+ * Measurement is completed.  Respond to the Sensor Get requests received while measurement
+ * was in progress and check if the publication is required.
+ */
+void mesh_sensor_measure_complete(int8_t value)
+{
+    wiced_bt_mesh_core_config_sensor_t *p_sensor = mesh_sensor_measure.p_publish_sensor;
+    uint8_t num_pending_get = mesh_sensor_measure.num_pending_get;
+    uint8_t i;
+
+    mesh_sensor_current_value = value;
+
+    mesh_sensor_measure.p_publish_sensor = NULL;
+    mesh_sensor_measure.num_pending_get  = 0;
+
+    if (num_pending_get != 0)
+    {
+        // update the value in mesh_config, the library will get data from there
+        mesh_sensor_sent_value = value;
+
+        for (i = 0; i < num_pending_get; i++)
+        {
+            wiced_bt_mesh_model_sensor_server_data(mesh_sensor_measure.pending_get[i].element_idx,
+                    mesh_sensor_measure.pending_get[i].property_id, mesh_sensor_measure.pending_get[i].p_ref_data);
+        }
+    }
+    if (p_sensor != NULL)
+    {
+        mesh_sensor_publish_check(p_sensor);
+    }
+}
+
+#if defined(LOW_POWER_NODE) && (LOW_POWER_NODE == 1)
+/*
+ * Abort the measurement in progress before HID-Off and power down the divider.  On LPN Sensor Get is
+ * answered synchronously, so only the publication check can be waiting.  A publication queued here would
+ * not be sent before HID-Off, so it is skipped; mesh_app_init measures and publishes after wake up.
+ */
+void mesh_sensor_measure_abort(void)
+{
+    wiced_bt_mesh_core_config_sensor_t *p_sensor = mesh_sensor_measure.p_publish_sensor;
+
+    if (mesh_sensor_measure.state == MESH_SENSOR_MEASURE_STATE_IDLE)
+    {
+        return;
+    }
+    WICED_BT_TRACE("measure abort\n");
+
+    wiced_stop_timer(&mesh_sensor_measure_timer);
+    mesh_sensor_measure_power_off();
+    mesh_sensor_measure.state            = MESH_SENSOR_MEASURE_STATE_IDLE;
+    mesh_sensor_measure.p_publish_sensor = NULL;
+
+    // restart the cadence timer in case HID-Off fails
+    if (p_sensor != NULL)
+    {
+        mesh_sensor_server_restart_timer(p_sensor);
+    }
+}
+#endif
+
 /*
  * Process the configuration changes set by the Sensor Client.
  */
@@ -519,11 +825,26 @@ void mesh_sensor_server_report_handler(uint16_t event, uint8_t element_idx, void
     switch (event)
     {
     case WICED_BT_MESH_SENSOR_GET:
-        // measure the temperature and update it to mesh_config
+#if defined(LOW_POWER_NODE) && (LOW_POWER_NODE == 1)
+        // LPN may enter HID-Off before a staged measurement completes, measure synchronously and respond now
         mesh_sensor_sent_value = mesh_sensor_get_temperature_8();
-
-        // tell mesh models library that data is ready to be shipped out, the library will get data from mesh_config
         wiced_bt_mesh_model_sensor_server_data(element_idx, p_sensor_get->property_id, p_ref_data);
+#else
+        if (mesh_sensor_measure.num_pending_get >= MESH_SENSOR_MAX_PENDING_GET)
+        {
+            // too many requests in flight, respond with the last measured value
+            WICED_BT_TRACE("pending get overflow\n");
+            mesh_sensor_sent_value = mesh_sensor_current_value;
+            wiced_bt_mesh_model_sensor_server_data(element_idx, p_sensor_get->property_id, p_ref_data);
+            break;
+        }
+        // measure the temperature, response is sent when measurement completes
+        mesh_sensor_measure.pending_get[mesh_sensor_measure.num_pending_get].element_idx = element_idx;
+        mesh_sensor_measure.pending_get[mesh_sensor_measure.num_pending_get].property_id = p_sensor_get->property_id;
+        mesh_sensor_measure.pending_get[mesh_sensor_measure.num_pending_get].p_ref_data  = p_ref_data;
+        mesh_sensor_measure.num_pending_get++;
+        mesh_sensor_measure_start();
+#endif
         break;
 
     case WICED_BT_MESH_SENSOR_COLUMN_GET:
@@ -565,19 +886,28 @@ void mesh_sensor_server_process_cadence_changed(uint8_t element_idx, wiced_bt_me
 }
 
 /*
- * Publication timer callback.  Need to send data if publish period expired, or
+ * Publication timer callback.  Start the measurement, the publication is checked when it completes.
+ */
+void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
+{
+    mesh_sensor_measure.p_publish_sensor = (wiced_bt_mesh_core_config_sensor_t *)arg;
+    mesh_sensor_measure_start();
+}
+
+/*
+ * Check publication with the new measured value.  Need to send data if publish period expired, or
  * if value has changed more than specified in the triggers, or if value is in range
  * of fast cadence values.
  */
-void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
+void mesh_sensor_publish_check(wiced_bt_mesh_core_config_sensor_t *p_sensor)
 {
     wiced_bt_mesh_event_t *p_event;
-    wiced_bt_mesh_core_config_sensor_t *p_sensor = (wiced_bt_mesh_core_config_sensor_t *)arg;
     wiced_bool_t pub_needed = WICED_FALSE;
+    wiced_bool_t periodic = WICED_TRUE;
+    wiced_bool_t fast_cadence_entered;
+    uint8_t delta;
     uint32_t cur_time = wiced_bt_mesh_core_get_tick_count();
 
-    mesh_sensor_current_value = mesh_sensor_get_temperature_8();
-
     if ((cur_time - mesh_sensor_pub_time) < p_sensor->cadence.min_interval)
     {
         WICED_BT_TRACE("time since last pub:%d less then cadence interval:%d\n", cur_time - mesh_sensor_pub_time, p_sensor->cadence.min_interval);
@@ -604,6 +934,7 @@ void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
                 {
                     WICED_BT_TRACE("Pub needed native value\n");
                     pub_needed = WICED_TRUE;
+                    periodic = WICED_FALSE;
                 }
             }
             else
@@ -616,6 +947,7 @@ void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
                     {
                         WICED_BT_TRACE("Pub needed percent delta up:%d\n", ((mesh_sensor_current_value - mesh_sensor_pub_value) * 10000 / mesh_sensor_current_value));
                         pub_needed = WICED_TRUE;
+                        periodic = WICED_FALSE;
                     }
                 }
                 else if ((p_sensor->cadence.trigger_delta_down != 0) && (mesh_sensor_current_value < mesh_sensor_pub_value))
@@ -625,6 +957,7 @@ void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
                     {
                         WICED_BT_TRACE("Pub needed percent delta down:%d\n", ((mesh_sensor_pub_value - mesh_sensor_current_value) * 10000 / mesh_sensor_current_value));
                         pub_needed = WICED_TRUE;
+                        periodic = WICED_FALSE;
                     }
                 }
             }
@@ -633,37 +966,11 @@ void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
         if (!pub_needed && (mesh_sensor_fast_publish_period != 0))
         {
             // check if fast publish period expired
-            if (cur_time - mesh_sensor_pub_time >= mesh_sensor_fast_publish_period)
+            if ((cur_time - mesh_sensor_pub_time >= mesh_sensor_fast_publish_period) &&
+                mesh_sensor_in_fast_cadence_range(p_sensor, mesh_sensor_current_value))
             {
-                // if cadence high is more than cadence low, to publish, the value should be in range
-                if (p_sensor->cadence.fast_cadence_high > p_sensor->cadence.fast_cadence_low)
-                {
-                    if ((mesh_sensor_current_value > p_sensor->cadence.fast_cadence_low) &&
-                        (mesh_sensor_current_value <= p_sensor->cadence.fast_cadence_high))
-                    {
-                        WICED_BT_TRACE("Pub needed in range\n");
-                        pub_needed = WICED_TRUE;
-                    }
-                }
-                else if (p_sensor->cadence.fast_cadence_high < p_sensor->cadence.fast_cadence_low)
-                {
-                    if ((mesh_sensor_current_value > p_sensor->cadence.fast_cadence_low) ||
-                        (mesh_sensor_current_value < p_sensor->cadence.fast_cadence_high))
-                    {
-                        WICED_BT_TRACE("Pub needed out of range\n");
-                        pub_needed = WICED_TRUE;
-                    }
-                }
-                else
-                {
-                    // p_sensor->cadence.fast_cadence_high == p_sensor->cadence.fast_cadence_low)
-                    // publish if current value is the same as cadence high/low
-                    if (mesh_sensor_current_value == p_sensor->cadence.fast_cadence_low)
-                    {
-                        WICED_BT_TRACE("Pub needed equal\n");
-                        pub_needed = WICED_TRUE;
-                    }
-                }
+                WICED_BT_TRACE("Pub needed fast cadence\n");
+                pub_needed = WICED_TRUE;
             }
         }
         // We will still send publication if Deltas are not set, but measured value has changed.
@@ -673,25 +980,120 @@ void mesh_sensor_publish_timer_callback(TIMER_PARAM_TYPE arg)
             {
                WICED_BT_TRACE("Pub needed new value no deltas\n");
                pub_needed = WICED_TRUE;
+               periodic = WICED_FALSE;
             }
         }
         if (pub_needed)
         {
+            delta = (uint8_t)((mesh_sensor_current_value > mesh_sensor_pub_value) ?
+                    (mesh_sensor_current_value - mesh_sensor_pub_value) : (mesh_sensor_pub_value - mesh_sensor_current_value));
+            fast_cadence_entered = (mesh_sensor_fast_publish_period != 0) &&
+                                   mesh_sensor_in_fast_cadence_range(p_sensor, mesh_sensor_current_value) &&
+                                   !mesh_sensor_in_fast_cadence_range(p_sensor, mesh_sensor_pub_value);
+
             mesh_sensor_sent_value = mesh_sensor_current_value;
             mesh_sensor_pub_value  = mesh_sensor_current_value;
             mesh_sensor_pub_time   = cur_time;
 
             WICED_BT_TRACE("Pub value:%d time:%d\n", mesh_sensor_sent_value, mesh_sensor_pub_time);
-            wiced_bt_mesh_model_sensor_server_data(MESH_SENSOR_SERVER_ELEMENT_INDEX, WICED_BT_MESH_PROPERTY_PRESENT_AMBIENT_TEMPERATURE, NULL);
+
+            // Event created with dst 0 carries the model publication parameters, same as the library creates for NULL.
+            // If it cannot be created, the library publishes with the model publication parameters.
+            p_event = wiced_bt_mesh_create_event(MESH_SENSOR_SERVER_ELEMENT_INDEX, MESH_COMPANY_ID_BT_SIG, WICED_BT_MESH_CORE_MODEL_ID_SENSOR_SRV, 0, 0);
+            if (p_event != NULL)
+            {
+                mesh_sensor_pub_policy_apply(p_event, periodic, delta, fast_cadence_entered);
+            }
+            wiced_bt_mesh_model_sensor_server_data(MESH_SENSOR_SERVER_ELEMENT_INDEX, WICED_BT_MESH_PROPERTY_PRESENT_AMBIENT_TEMPERATURE, p_event);
         }
     }
     mesh_sensor_server_restart_timer(p_sensor);
 }
 
+/*
+ * Returns WICED_TRUE if the value is in the range in which fast cadence has to be observed.
+ */
+wiced_bool_t mesh_sensor_in_fast_cadence_range(wiced_bt_mesh_core_config_sensor_t *p_sensor, int8_t value)
+{
+    // if cadence high is more than cadence low, the value should be in range
+    if (p_sensor->cadence.fast_cadence_high > p_sensor->cadence.fast_cadence_low)
+    {
+        return (value > p_sensor->cadence.fast_cadence_low) && (value <= p_sensor->cadence.fast_cadence_high);
+    }
+    // if cadence high is less than cadence low, the value should be out of range
+    else if (p_sensor->cadence.fast_cadence_high < p_sensor->cadence.fast_cadence_low)
+    {
+        return (value > p_sensor->cadence.fast_cadence_low) || (value < p_sensor->cadence.fast_cadence_high);
+    }
+    // p_sensor->cadence.fast_cadence_high == p_sensor->cadence.fast_cadence_low)
+    // the value should be the same as cadence high/low
+    return value == p_sensor->cadence.fast_cadence_low;
+}
+
+/*
+ * Select retransmissions of the publication.  Periodic publication of the unchanged value is sent with minimal
+ * retransmissions, large change or entry into fast cadence range is sent with extra retransmissions.  All other
+ * publications keep retransmissions configured for the model publication.
+ * The retrans_time of the event is the interval in 50ms units, not the Interval Steps of Config Model Publication.
+ */
+void mesh_sensor_pub_policy_apply(wiced_bt_mesh_event_t *p_event, wiced_bool_t periodic, uint8_t delta, wiced_bool_t fast_cadence_entered)
+{
+    uint8_t *p_policy = mesh_temperature_sensor_setting1_val;
+    uint8_t retrans_cnt;
+    uint8_t retrans_time;
+
+    if (p_policy[MESH_SENSOR_PUB_POLICY_LARGE_DELTA] == 0)
+    {
+        return;
+    }
+
+    if (fast_cadence_entered || (delta >= p_policy[MESH_SENSOR_PUB_POLICY_LARGE_DELTA]))
+    {
+        retrans_cnt  = p_policy[MESH_SENSOR_PUB_POLICY_BOOST_RETRANS_CNT];
+        retrans_time = p_policy[MESH_SENSOR_PUB_POLICY_BOOST_RETRANS_TIME];
+    }
+    else if ((delta <= p_policy[MESH_SENSOR_PUB_POLICY_SMALL_DELTA]) && periodic)
+    {
+        retrans_cnt  = p_policy[MESH_SENSOR_PUB_POLICY_BASE_RETRANS_CNT];
+        retrans_time = p_policy[MESH_SENSOR_PUB_POLICY_BASE_RETRANS_TIME];
+    }
+    else
+    {
+        WICED_BT_TRACE("Pub periodic:%d delta:%d model retransmit\n", periodic, delta);
+        return;
+    }
+    if (retrans_cnt > MESH_SENSOR_MAX_RETRANS_CNT)
+    {
+        retrans_cnt = MESH_SENSOR_MAX_RETRANS_CNT;
+    }
+    if (retrans_time == 0)
+    {
+        retrans_time = 1;
+    }
+    else if (retrans_time > MESH_SENSOR_MAX_RETRANS_TIME)
+    {
+        retrans_time = MESH_SENSOR_MAX_RETRANS_TIME;
+    }
+
+    p_event->retrans_cnt  = retrans_cnt;
+    p_event->retrans_time = retrans_time;
+    WICED_BT_TRACE("Pub periodic:%d delta:%d fast entered:%d retransmit cnt:%d time:%d\n", periodic, delta, fast_cadence_entered, retrans_cnt, retrans_time);
+}
+
 /*
  * Process setting change
  */
 void mesh_sensor_server_process_setting_changed(uint8_t element_idx, wiced_bt_mesh_sensor_setting_status_data_t* p_data)
 {
+    uint8_t written_byte = 0;
+    wiced_result_t status;
+
     WICED_BT_TRACE("settings changed property id of sensor = %x , sensor prop id = %x \n", p_data->property_id, p_data->setting.setting_property_id);
+
+    if (p_data->setting.setting_property_id == MESH_TEMPERATURE_SENSOR_PUB_POLICY_PROPERTY_ID)
+    {
+        /* save publication retransmit policy to NVRAM */
+        written_byte = wiced_hal_write_nvram(MESH_TEMPERATURE_SENSOR_PUB_POLICY_NVRAM_ID, MESH_TEMPERATURE_SENSOR_PUB_POLICY_LEN, mesh_temperature_sensor_setting1_val, &status);
+        WICED_BT_TRACE("NVRAM write: %d\n", written_byte);
+    }
 }
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+#
+# Simulates delivery rate of a mesh publication against the number of retransmissions and the interval
+# between them on a channel with interference bursts (two state Gilbert-Elliott model).  The results are
+# used to select defaults of the publication retransmit policy in sensor_temperature.c.
+#
+# Usage: python3 tools/pub_retransmit_sim.py
+#
+import random
+
+SLOT_MS        = 10        # simulation time step
+LOSS_GOOD      = 0.05      # loss of a transmission between bursts
+LOSS_BAD       = 0.80      # loss of a transmission in a burst
+MEAN_BURST_MS  = 150       # mean burst duration
+MEAN_GAP_MS    = 1350      # mean time between bursts
+MESSAGES       = 200000    # messages simulated for each configuration
+INTERVALS_MS   = (50, 100, 200, 400)
+MAX_RETRANS    = 4
+
+def delivery_rate(retrans_cnt, interval_ms):
+    p_to_bad  = SLOT_MS / MEAN_GAP_MS
+    p_to_good = SLOT_MS / MEAN_BURST_MS
+    step      = interval_ms // SLOT_MS
+    delivered = 0
+    for _ in range(MESSAGES):
+        bad = random.random() < MEAN_BURST_MS / (MEAN_BURST_MS + MEAN_GAP_MS)
+        for copy in range(retrans_cnt + 1):
+            if random.random() >= (LOSS_BAD if bad else LOSS_GOOD):
+                delivered += 1
+                break
+            for _ in range(step):
+                bad = (random.random() >= p_to_good) if bad else (random.random() < p_to_bad)
+    return 100.0 * delivered / MESSAGES
+
+def main():
+    random.seed(1)
+    print("retrans airtime " + " ".join("%7dms" % i for i in INTERVALS_MS))
+    for cnt in range(MAX_RETRANS + 1):
+        print("%7d      x%d " % (cnt, cnt + 1) + " ".join("%8.2f%%" % delivery_rate(cnt, i) for i in INTERVALS_MS))
+
+if __name__ == "__main__":
+    main()